@@ -15,15 +15,32 @@
  * token_t::payload : 16
  * token_t : 32
  *
+ * Output formats:
+ * --aos (default) : an array of token_t terminated by a TKN_MAX sentinel,
+ *                   followed by the NUL-terminated strings of every
+ *                   TKN_ALNUM_PTR token, in token order.
+ * --soa           : a structure-of-arrays layout (see token_soa and
+ *                   write_soa()), in which kind-only scans touch a single
+ *                   byte per token.
+ * --index[=K]     : append a random-access index to either format (see
+ *                   write_index()), with a checkpoint every K tokens and the
+ *                   positions of top-level ';' and '}' tokens.
+ * --recover       : instead of stopping at the first lexical error, emit a
+ *                   TKN_ERR token for the bad span, resynchronize and keep
+ *                   going; all errors are reported together at the end.
+ *
  *  Created on: Feb 14, 2017
  *      Author: Duncan
  */
 
 #include <regex.h>
+#include <stdint.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
 
+#include "token.h"
+
 #ifdef DEBUG
 #undef DEBUG
 #define DEBUG 1
@@ -31,30 +48,8 @@
 #define DEBUG 0
 #endif
 
-#define TKN_KEYWD 0
-#define TKN_ID 1
-#define TKN_INT 2
-#define TKN_FLOAT 3
-#define TKN_CHAR 4
-#define TKN_STR 5
-#define TKN_OPER 6
-#define TKN_GROUP 7
-#define TKN_TERM 8
-#define TKN_MAX 9
-
-#define TKN_INT_STD 0
-#define TKN_INT_U 1
-#define TKN_INT_L 2
-#define TKN_INT_UL 3
-#define TKN_INT_LL 4
-#define TKN_INT_ULL 5
-
-#define TKN_FLOAT_F 0
-#define TKN_FLOAT_D 1
-#define TKN_FLOAT_LD 2
-
-#define TKN_ALNUM_EMB 0
-#define TKN_ALNUM_PTR 1
+#define FMT_AOS 0
+#define FMT_SOA 1
 
 #define NOERR 0
 #define ERR_IO 1
@@ -63,6 +58,7 @@
 #define REGEX_FLAGS (REG_EXTENDED | REG_ICASE | REG_NEWLINE)
 #define MAX_ID_LEN 32
 #define LN_BUFSIZ 1024
+#define INDEX_EVERY_DEF 256
 
 typedef int errr;
 typedef int bool;
@@ -73,29 +69,14 @@ typedef struct string_list {
     struct string_list * next;
 } string_list;
 
-typedef struct {
-    int type;
-    int subtype;
-    union {
-        int kwid;
-        char* aid_ptr;
-        char aid_emb[16];
-        int i;
-        unsigned int ui;
-        long int li;
-        unsigned long int uli;
-        long long int lli;
-        unsigned long long int ulli;
-        float f;
-        double d;
-        long double ld;
-        char c;
-        char* str_ptr;
-        char str_emb[16];
-        char op[3];
-        char gr;
-    } payload;
-} token_t;
+typedef struct lex_error {
+    src_span span;
+    uint line;
+    uint col;
+    int kind;
+    char* text;
+    struct lex_error * next;
+} lex_error;
 
 struct token_list {
     token_t token;
@@ -103,8 +84,53 @@ struct token_list {
 };
 typedef struct token_list token_list;
 
+/*
+ * Structure-of-arrays view of a token stream. kind and subtype hold one byte
+ * per token; each payload array holds only the tokens of its own kind, in
+ * stream order, so the n-th payload of a kind belongs to the n-th token of
+ * that kind. TKN_ID and TKN_STR payloads are offsets into strpool.
+ */
+typedef struct {
+    uint count;
+    uint8_t* kind;
+    uint8_t* subtype;
+    uint pcount[TKN_NKINDS];
+    int8_t* kwid;
+    uint* id;
+    unsigned long long* ival;
+    long double* fval;
+    char* cval;
+    uint* str;
+    char (*op)[3];
+    char* gr;
+    src_span* err;
+    char* strpool;
+    uint strpool_len;
+} token_soa;
+
+/* Where a writer put the token records and strings of its stream */
+typedef struct {
+    uint64_t tok_base;
+    uint64_t str_base;
+    uint64_t pbase[TKN_NKINDS];
+    uint64_t size;
+    uint tok_stride;
+} stream_layout;
+
+typedef struct {
+    index_hdr hdr;
+    idx_checkpoint* check;
+    uint* term;
+    uint* close;
+} token_index;
+
 token_list * head = NULL;
 token_list * tail = NULL;
+int out_fmt = FMT_AOS;
+uint index_every = 0;
+bool recover = 0;
+lex_error * err_head = NULL;
+lex_error * err_tail = NULL;
 
 const char* patterns[TKN_MAX] =
         {
@@ -124,6 +150,16 @@ regex_t regexen[TKN_MAX];
 errr init_regex(void);
 errr lex(FILE *, FILE *);
 errr make_token(char*, int);
+errr make_error(char*, int, int, unsigned long, uint, uint);
+bool token_at(char*);
+errr report_errors(void);
+errr write_aos(FILE *, stream_layout *);
+errr build_soa(token_soa *);
+errr write_soa(token_soa *, FILE *, stream_layout *);
+void free_soa(token_soa *);
+errr build_index(token_index *);
+errr write_index(token_index *, stream_layout *, FILE *);
+void free_index(token_index *);
 int get_kwid(char*);
 void printhlp(void);
 
@@ -131,6 +167,32 @@ int main(int argc, char** argv) {
     FILE * input = stdin;
     FILE * output = stdout;
 
+    int argi = 1;
+    while (argi < argc && !strncmp(argv[argi], "--", 2)
+            && strcmp(argv[argi], "--help")) {
+        if (!strcmp(argv[argi], "--aos")) {
+            out_fmt = FMT_AOS;
+        } else if (!strcmp(argv[argi], "--soa")) {
+            out_fmt = FMT_SOA;
+        } else if (!strcmp(argv[argi], "--recover")) {
+            recover = 1;
+        } else if (!strcmp(argv[argi], "--index")) {
+            index_every = INDEX_EVERY_DEF;
+        } else if (!strncmp(argv[argi], "--index=", 8)) {
+            index_every = (uint) strtoul(argv[argi] + 8, NULL, 10);
+            if (!index_every) {
+                printhlp();
+                return NOERR;
+            }
+        } else {
+            printhlp();
+            return NOERR;
+        }
+        argi++;
+    }
+    argc -= argi - 1;
+    argv += argi - 1;
+
     switch (argc) {
         case 3:
             output = fopen(argv[2], "wb");
@@ -154,10 +216,8 @@ int main(int argc, char** argv) {
     }
     if(DEBUG) printf("Init\n");
     err = lex(input, output);
-    if (err) {
-        printf("Error: %d\n", err);
-        return err;
-    }
+    /* stderr -- the output stream may be stdout, and may be complete */
+    if (err) fprintf(stderr, "Error: %d\n", err);
     fclose(input);
     fclose(output);
 
@@ -168,11 +228,16 @@ errr lex(FILE * in, FILE * out) {
     char buf[LN_BUFSIZ];
     regmatch_t pmatch;
     errr err = NOERR;
+    unsigned long srcoff = 0;
+    uint lineno = 1;
+    uint colbase = 0;
     while (!feof(in)) {
         if(DEBUG) printf("Loop start\n");
-        /* Read line */
-        fgets(buf, LN_BUFSIZ, in);
-        if (ferror(in)) return ERR_IO;
+        /* Read line -- at end of file buf is left untouched, so stop */
+        if (!fgets(buf, LN_BUFSIZ, in)) {
+            if (ferror(in)) return ERR_IO;
+            break;
+        }
         if(DEBUG) printf("Read line\n");
         char *line = buf;
         while (*line) {
@@ -194,17 +259,152 @@ errr lex(FILE * in, FILE * out) {
                         "End Regex loop: matched %d:%d for token pattern %d. Current token ID is %d, length %d\n",
                         pmatch.rm_so, pmatch.rm_eo, i, curkind, curlen);
             }
-            if (curkind == -1) return ERR_PARSE_ERR;
+            if (curkind == -1) {
+                if (!recover) return ERR_PARSE_ERR;
+                curlen = 1;
+                if ((*line == '"') || (*line == '\'')) {
+                    /*
+                     * A rejected literal -- its contents are not tokens, so
+                     * resynchronize past the closing quote, or at the end of
+                     * the line if there is none
+                     */
+                    while (line[curlen] && (line[curlen] != '\n')
+                            && (line[curlen] != *line)) {
+                        if ((line[curlen] == '\\') && line[curlen + 1]
+                                && (line[curlen + 1] != '\n')) curlen++;
+                        curlen++;
+                    }
+                    if (line[curlen] == *line) curlen++;
+                } else {
+                    /* Resynchronize at the next blank or recognizable token */
+                    while (line[curlen] && !isspace(line[curlen])
+                            && !token_at(line + curlen)) {
+                        curlen++;
+                    }
+                }
+                err = make_error(line, curlen, LEXERR_CHAR,
+                        srcoff + (line - buf), lineno,
+                        colbase + (line - buf) + 1);
+                if (err) return err;
+                line += curlen;
+                continue;
+            }
             if(DEBUG) printf("Identified token\n");
             char* tok = malloc((curlen + 1) * sizeof(char));
             strncpy(tok, line, curlen);
             tok[curlen] = '\0';
-            line += curlen;
+            token_list * prev = tail;
             err = make_token(tok, curkind);
+            if ((err == ERR_PARSE_ERR) && recover) {
+                /* Replace the half-built token by an error token */
+                if (curkind == TKN_STR) free(tail->token.payload.str_ptr);
+                free(tok);
+                free(tail);
+                tail = prev;
+                if (tail) tail->next = NULL;
+                else head = NULL;
+                err = make_error(line, curlen, LEXERR_TOKEN,
+                        srcoff + (line - buf), lineno,
+                        colbase + (line - buf) + 1);
+            }
             if (err) return err;
+            line += curlen;
+        }
+        size_t len = strlen(buf);
+        srcoff += len;
+        if (len && (buf[len - 1] == '\n')) {
+            lineno++;
+            colbase = 0;
+        } else {
+            colbase += len;
         }
     }
     if(DEBUG) printf("End tokenizer loop\n");
+    token_index idx;
+    stream_layout layout;
+    memset(&idx, 0, sizeof(token_index));
+    /* The index must be built before the writers consume the token list */
+    if (index_every) err = build_index(&idx);
+    if (!err) {
+        if (out_fmt == FMT_SOA) {
+            token_soa soa;
+            err = build_soa(&soa);
+            if (!err) err = write_soa(&soa, out, &layout);
+            free_soa(&soa);
+        } else {
+            err = write_aos(out, &layout);
+        }
+    }
+    if (!err && index_every) err = write_index(&idx, &layout, out);
+    free_index(&idx);
+    if (!err) err = report_errors();
+    return err;
+}
+
+/* Whether any token pattern matches at the very start of line */
+bool token_at(char* line) {
+    regmatch_t pmatch;
+    for (int i = 0; i < TKN_MAX; i++) {
+        if ((!regexec(&regexen[i], line, 1, &pmatch, 0))
+                && (pmatch.rm_so == 0) && (pmatch.rm_eo > 0)) return 1;
+    }
+    return 0;
+}
+
+/*
+ * Append a TKN_ERR token for the len bytes at text, and queue the error to
+ * be reported by report_errors().
+ */
+errr make_error(char* text, int len, int kind, unsigned long off, uint line,
+        uint col) {
+    lex_error * e = (lex_error*) malloc(sizeof(lex_error));
+    token_list * t = (token_list*) malloc(sizeof(token_list));
+    if (!e || !t) return ERR_IO;
+    e->span.off = off;
+    e->span.len = len;
+    e->line = line;
+    e->col = col;
+    e->kind = kind;
+    e->text = (char*) malloc((len + 1) * sizeof(char));
+    if (!e->text) return ERR_IO;
+    strncpy(e->text, text, len);
+    e->text[len] = '\0';
+    e->next = NULL;
+    if (err_tail) err_tail->next = e;
+    else err_head = e;
+    err_tail = e;
+    memset(t, 0, sizeof(token_list));
+    t->token.type = TKN_ERR;
+    t->token.subtype = kind;
+    t->token.payload.err = e->span;
+    if (tail) tail->next = t;
+    else head = t;
+    tail = t;
+    if(DEBUG) printf("Error token at offset %lu\n", off);
+    return NOERR;
+}
+
+/* Print every queued error to stderr and free the queue. */
+errr report_errors() {
+    errr err = NOERR;
+    while (err_head != NULL) {
+        fprintf(stderr, "%u:%u: offset %lu: %s '%s'\n", err_head->line,
+                err_head->col, err_head->span.off,
+                (err_head->kind == LEXERR_CHAR) ?
+                        "unrecognized input" : "malformed token",
+                err_head->text);
+        lex_error * del = err_head;
+        err_head = err_head->next;
+        free(del->text);
+        free(del);
+        err = ERR_PARSE_ERR;
+    }
+    err_tail = NULL;
+    return err;
+}
+
+errr write_aos(FILE * out, stream_layout * layout) {
+    uint count = 0;
     string_list * str_hack_head = NULL;
     string_list * str_hack_tail = NULL;
     uint str_hack_idx = 0;
@@ -221,6 +421,7 @@ errr lex(FILE * in, FILE * out) {
                         sizeof(string_list));
                 str_hack_tail = str_hack_tail->next;
             }
+            str_hack_tail->next = NULL;
             if(DEBUG) printf("For string '%s'", head->token.payload.aid_ptr);
             str_hack_tail->str = head->token.payload.aid_ptr;
             /* ... and use fake pointers for writing */
@@ -229,6 +430,7 @@ errr lex(FILE * in, FILE * out) {
         } else if(DEBUG) printf("No hack necessary\n");
         fwrite(&(head->token), sizeof(token_t), 1, out);
         if (ferror(out)) return ERR_IO;
+        count++;
         token_list * del = head;
         head = head->next;
         free(del);
@@ -239,12 +441,18 @@ errr lex(FILE * in, FILE * out) {
     fwrite(&sentinel, sizeof(token_t), 1, out);
     if(DEBUG) printf("Written sentinel \n");
     fflush(out);
+    layout->tok_base = 0;
+    layout->tok_stride = sizeof(token_t);
+    memset(layout->pbase, 0, sizeof(layout->pbase));
+    layout->str_base = (uint64_t) (count + 1) * sizeof(token_t);
+    layout->size = layout->str_base;
     /* Hack -- now actually store the hacked strings */
     while (str_hack_head != NULL) {
         if(DEBUG) printf("Writing string %p\n"/* '%s'\n", str_hack_head->str*/,
                 str_hack_head->str);
         fwrite(str_hack_head->str, sizeof(char), strlen(str_hack_head->str) + 1,
                 out);
+        layout->size += strlen(str_hack_head->str) + 1;
         if (ferror(out)) {
             printf("IOError\n");
             return ERR_IO;
@@ -258,12 +466,319 @@ errr lex(FILE * in, FILE * out) {
     return NOERR;
 }
 
+/* Convert the token list into a token_soa, consuming the list. */
+errr build_soa(token_soa * soa) {
+    memset(soa, 0, sizeof(token_soa));
+    /* First pass -- size every array exactly */
+    for (token_list * cur = head; cur != NULL; cur = cur->next) {
+        soa->count++;
+        soa->pcount[cur->token.type]++;
+        if ((cur->token.type == TKN_ID) || (cur->token.type == TKN_STR)) {
+            soa->strpool_len += strlen(
+                    (cur->token.subtype == TKN_ALNUM_PTR) ?
+                            cur->token.payload.aid_ptr :
+                            cur->token.payload.aid_emb) + 1;
+        }
+    }
+    soa->kind = (uint8_t*) malloc(soa->count + 1);
+    soa->subtype = (uint8_t*) malloc(soa->count + 1);
+    soa->kwid = (int8_t*) malloc(soa->pcount[TKN_KEYWD] + 1);
+    soa->id = (uint*) malloc((soa->pcount[TKN_ID] + 1) * sizeof(uint));
+    soa->ival = (unsigned long long*) malloc(
+            (soa->pcount[TKN_INT] + 1) * sizeof(unsigned long long));
+    soa->fval = (long double*) malloc(
+            (soa->pcount[TKN_FLOAT] + 1) * sizeof(long double));
+    soa->cval = (char*) malloc(soa->pcount[TKN_CHAR] + 1);
+    soa->str = (uint*) malloc((soa->pcount[TKN_STR] + 1) * sizeof(uint));
+    soa->op = (char (*)[3]) malloc((soa->pcount[TKN_OPER] + 1) * 3);
+    soa->gr = (char*) malloc(soa->pcount[TKN_GROUP] + 1);
+    soa->err = (src_span*) malloc(
+            (soa->pcount[TKN_ERR] + 1) * sizeof(src_span));
+    soa->strpool = (char*) malloc(soa->strpool_len + 1);
+    if (!soa->kind || !soa->subtype || !soa->kwid || !soa->id || !soa->ival
+            || !soa->fval || !soa->cval || !soa->str || !soa->op || !soa->gr
+            || !soa->err || !soa->strpool) return ERR_IO;
+    /* Second pass -- scatter the payloads */
+    uint pidx[TKN_NKINDS] = { 0 };
+    uint pool = 0;
+    uint n = 0;
+    while (head != NULL) {
+        token_t * t = &head->token;
+        soa->kind[n] = (uint8_t) t->type;
+        soa->subtype[n] = (uint8_t) t->subtype;
+        uint p = pidx[t->type]++;
+        switch (t->type) {
+            case TKN_KEYWD:
+                soa->kwid[p] = (int8_t) t->payload.kwid;
+                soa->subtype[n] = 0;
+                break;
+            case TKN_ID:
+            case TKN_STR: {
+                char* s = (t->subtype == TKN_ALNUM_PTR) ?
+                        t->payload.aid_ptr : t->payload.aid_emb;
+                uint len = strlen(s) + 1;
+                memcpy(soa->strpool + pool, s, len);
+                if (t->type == TKN_ID) soa->id[p] = pool;
+                else soa->str[p] = pool;
+                pool += len;
+                if (t->subtype == TKN_ALNUM_PTR) free(s);
+                break;
+            }
+            case TKN_INT:
+                switch (t->subtype) {
+                    case TKN_INT_STD:
+                        soa->ival[p] = (unsigned long long) t->payload.i;
+                        break;
+                    case TKN_INT_U:
+                        soa->ival[p] = t->payload.ui;
+                        break;
+                    case TKN_INT_L:
+                        soa->ival[p] = (unsigned long long) t->payload.li;
+                        break;
+                    case TKN_INT_UL:
+                        soa->ival[p] = t->payload.uli;
+                        break;
+                    case TKN_INT_LL:
+                        soa->ival[p] = (unsigned long long) t->payload.lli;
+                        break;
+                    default:
+                        soa->ival[p] = t->payload.ulli;
+                        break;
+                }
+                break;
+            case TKN_FLOAT:
+                switch (t->subtype) {
+                    case TKN_FLOAT_F:
+                        soa->fval[p] = t->payload.f;
+                        break;
+                    case TKN_FLOAT_D:
+                        soa->fval[p] = t->payload.d;
+                        break;
+                    default:
+                        soa->fval[p] = t->payload.ld;
+                        break;
+                }
+                break;
+            case TKN_CHAR:
+                soa->cval[p] = t->payload.c;
+                soa->subtype[n] = 0;
+                break;
+            case TKN_OPER:
+                memcpy(soa->op[p], t->payload.op, 3);
+                soa->subtype[n] = 0;
+                break;
+            case TKN_GROUP:
+                soa->gr[p] = t->payload.gr;
+                soa->subtype[n] = 0;
+                break;
+            case TKN_ERR:
+                soa->err[p] = t->payload.err;
+                break;
+            default:
+                soa->subtype[n] = 0;
+                break;
+        }
+        token_list * del = head;
+        head = head->next;
+        free(del);
+        n++;
+    }
+    tail = NULL;
+    /* Sentinel, so kind scans may stop on TKN_MAX as with the AoS stream */
+    soa->kind[n] = TKN_MAX;
+    soa->subtype[n] = 0;
+    return NOERR;
+}
+
+/*
+ * Write nmemb elements of arr and pad with zeros to the next SOA_ALIGN
+ * boundary, so every array of the SoA stream can be mapped in place.
+ */
+static errr write_soa_arr(const void* arr, size_t size, size_t nmemb,
+        FILE * out, size_t * pos) {
+    static const char zeros[SOA_ALIGN] = { 0 };
+    fwrite(arr, size, nmemb, out);
+    *pos += size * nmemb;
+    if (*pos % SOA_ALIGN) {
+        size_t pad = SOA_ALIGN - *pos % SOA_ALIGN;
+        fwrite(zeros, 1, pad, out);
+        *pos += pad;
+    }
+    return ferror(out) ? ERR_IO : NOERR;
+}
+
+/*
+ * SoA stream layout, each section padded to SOA_ALIGN bytes:
+ *   uint count, uint pcount[TKN_NKINDS], uint strpool_len
+ *   uint8_t kind[count + 1]     (kind[count] == TKN_MAX)
+ *   uint8_t subtype[count + 1]
+ *   long double fval[pcount[TKN_FLOAT]]
+ *   src_span err[pcount[TKN_ERR]]  (source offset and length)
+ *   unsigned long long ival[pcount[TKN_INT]]  (bits of the subtype's type)
+ *   uint id[pcount[TKN_ID]], uint str[pcount[TKN_STR]]  (strpool offsets)
+ *   char op[pcount[TKN_OPER]][3]
+ *   int8_t kwid[pcount[TKN_KEYWD]]
+ *   char cval[pcount[TKN_CHAR]], char gr[pcount[TKN_GROUP]]
+ *   char strpool[strpool_len]
+ */
+errr write_soa(token_soa * soa, FILE * out, stream_layout * layout) {
+    size_t pos = 0;
+    errr err;
+    uint hdr[TKN_NKINDS + 2];
+    hdr[0] = soa->count;
+    memcpy(hdr + 1, soa->pcount, sizeof(soa->pcount));
+    hdr[TKN_NKINDS + 1] = soa->strpool_len;
+    if ((err = write_soa_arr(hdr, sizeof(uint), TKN_NKINDS + 2, out, &pos)))
+        return err;
+    layout->tok_base = pos;
+    layout->tok_stride = 1;
+    if ((err = write_soa_arr(soa->kind, 1, soa->count + 1, out, &pos))
+            || (err = write_soa_arr(soa->subtype, 1, soa->count + 1, out,
+                    &pos))) return err;
+    /* Payload arrays, largest elements first */
+    const int kinds[] = { TKN_FLOAT, TKN_ERR, TKN_INT, TKN_ID, TKN_STR,
+            TKN_OPER, TKN_KEYWD, TKN_CHAR, TKN_GROUP };
+    const void* arrs[] = { soa->fval, soa->err, soa->ival, soa->id, soa->str,
+            soa->op, soa->kwid, soa->cval, soa->gr };
+    const size_t sizes[] = { sizeof(long double), sizeof(src_span),
+            sizeof(unsigned long long), sizeof(uint), sizeof(uint), 3, 1, 1,
+            1 };
+    memset(layout->pbase, 0, sizeof(layout->pbase));
+    for (uint i = 0; i < sizeof(kinds) / sizeof(kinds[0]); i++) {
+        layout->pbase[kinds[i]] = pos;
+        if ((err = write_soa_arr(arrs[i], sizes[i], soa->pcount[kinds[i]],
+                out, &pos))) return err;
+    }
+    layout->str_base = pos;
+    if ((err = write_soa_arr(soa->strpool, 1, soa->strpool_len, out, &pos)))
+        return err;
+    layout->size = pos;
+    fflush(out);
+    if(DEBUG) printf("Written SoA stream of %lu bytes\n", (unsigned long) pos);
+    return NOERR;
+}
+
+/*
+ * Record a checkpoint every index_every tokens, and every top-level ';' and
+ * every '}' that closes back to brace depth zero, so a consumer can seek
+ * straight to a token or split the stream into top-level declarations.
+ * String offsets follow the string section of the selected output format.
+ */
+errr build_index(token_index * idx) {
+    uint depth = 0;
+    memset(idx, 0, sizeof(token_index));
+    /* First pass -- size the arrays */
+    for (token_list * cur = head; cur != NULL; cur = cur->next) {
+        if (!(idx->hdr.count++ % index_every)) idx->hdr.ncheck++;
+        if ((cur->token.type == TKN_TERM) && !depth) idx->hdr.nterm++;
+        else if (cur->token.type == TKN_GROUP) {
+            if (cur->token.payload.gr == '{') depth++;
+            else if ((cur->token.payload.gr == '}') && depth
+                    && !--depth) idx->hdr.nclose++;
+        }
+    }
+    idx->hdr.every = index_every;
+    idx->check = (idx_checkpoint*) malloc(
+            (idx->hdr.ncheck + 1) * sizeof(idx_checkpoint));
+    idx->term = (uint*) malloc((idx->hdr.nterm + 1) * sizeof(uint));
+    idx->close = (uint*) malloc((idx->hdr.nclose + 1) * sizeof(uint));
+    if (!idx->check || !idx->term || !idx->close) return ERR_IO;
+    /* Second pass -- fill them in */
+    idx_checkpoint state;
+    memset(&state, 0, sizeof(idx_checkpoint));
+    uint nc = 0, nt = 0, nb = 0;
+    depth = 0;
+    for (token_list * cur = head; cur != NULL; cur = cur->next) {
+        token_t * t = &cur->token;
+        if (!(state.tok % index_every)) idx->check[nc++] = state;
+        if ((t->type == TKN_TERM) && !depth) idx->term[nt++] = state.tok;
+        else if (t->type == TKN_GROUP) {
+            if (t->payload.gr == '{') depth++;
+            else if ((t->payload.gr == '}') && depth && !--depth)
+                idx->close[nb++] = state.tok;
+        }
+        if (((t->type == TKN_ID) || (t->type == TKN_STR))
+                && ((out_fmt == FMT_SOA) || (t->subtype == TKN_ALNUM_PTR))) {
+            state.str_idx++;
+            state.str_off += strlen(
+                    (t->subtype == TKN_ALNUM_PTR) ?
+                            t->payload.aid_ptr : t->payload.aid_emb) + 1;
+        }
+        state.pcount[t->type]++;
+        state.tok++;
+    }
+    return NOERR;
+}
+
+/*
+ * Index layout, written after the token stream and, like the SoA stream,
+ * with each section padded to SOA_ALIGN bytes so it can be mapped in place:
+ *   index_hdr, idx_checkpoint check[ncheck], uint term[nterm],
+ *   uint close[nclose]
+ * followed by a footer of the index's uint64_t byte offset and INDEX_MAGIC,
+ * so a reader finds the index from the last 12 bytes of the output. Token
+ * tok starts at tok_base + tok * tok_stride, and a checkpoint's next string
+ * at str_base + str_off. In an SoA stream, the next payload of kind k after
+ * a checkpoint is at pbase[k] + pcount[k] times that kind's element size
+ * (see write_soa()).
+ */
+errr write_index(token_index * idx, stream_layout * layout, FILE * out) {
+    size_t pos = layout->size;
+    uint magic = INDEX_MAGIC;
+    errr err;
+    idx->hdr.tok_base = layout->tok_base;
+    idx->hdr.str_base = layout->str_base;
+    idx->hdr.tok_stride = layout->tok_stride;
+    memcpy(idx->hdr.pbase, layout->pbase, sizeof(idx->hdr.pbase));
+    /* An AoS stream ends wherever its strings do -- align the index */
+    if ((err = write_soa_arr(&idx->hdr, sizeof(index_hdr), 0, out, &pos)))
+        return err;
+    uint64_t off = pos;
+    if ((err = write_soa_arr(&idx->hdr, sizeof(index_hdr), 1, out, &pos))
+            || (err = write_soa_arr(idx->check, sizeof(idx_checkpoint),
+                    idx->hdr.ncheck, out, &pos))
+            || (err = write_soa_arr(idx->term, sizeof(uint), idx->hdr.nterm,
+                    out, &pos))
+            || (err = write_soa_arr(idx->close, sizeof(uint),
+                    idx->hdr.nclose, out, &pos))) return err;
+    fwrite(&off, sizeof(uint64_t), 1, out);
+    fwrite(&magic, sizeof(uint), 1, out);
+    fflush(out);
+    if (ferror(out)) return ERR_IO;
+    if(DEBUG) printf("Written index at %lu\n", (unsigned long) off);
+    return NOERR;
+}
+
+void free_index(token_index * idx) {
+    free(idx->check);
+    free(idx->term);
+    free(idx->close);
+    memset(idx, 0, sizeof(token_index));
+}
+
+void free_soa(token_soa * soa) {
+    free(soa->kind);
+    free(soa->subtype);
+    free(soa->kwid);
+    free(soa->id);
+    free(soa->ival);
+    free(soa->fval);
+    free(soa->cval);
+    free(soa->str);
+    free(soa->op);
+    free(soa->gr);
+    free(soa->err);
+    free(soa->strpool);
+    memset(soa, 0, sizeof(token_soa));
+}
+
 errr make_token(char* tok, int type) {
+    /* Zeroed, so unused payload bytes are written out deterministically */
     if (tail) {
-        tail->next = (token_list*) malloc(sizeof(token_list));
+        tail->next = (token_list*) calloc(1, sizeof(token_list));
         tail = tail->next;
     } else {
-        head = (token_list*) malloc(sizeof(token_list));
+        head = (token_list*) calloc(1, sizeof(token_list));
         tail = head;
     }
     tail->next = NULL;
@@ -301,26 +816,33 @@ errr make_token(char* tok, int type) {
                         continue;
                 }
             }
+            /* strto*l() take no 0b prefix, so parse binary digits in base 2 */
+            char* digits = tok;
+            int base = 0;
             char* dump;
+            if ((tok[0] == '0') && ((tok[1] == 'B') || (tok[1] == 'b'))) {
+                digits += 2;
+                base = 2;
+            }
             switch (tail->token.subtype) {
                 case TKN_INT_STD:
-                    tail->token.payload.i = (int) strtol(tok, &dump, 0);
+                    tail->token.payload.i = (int) strtol(digits, &dump, base);
                     break;
                 case TKN_INT_U:
-                    tail->token.payload.ui = (unsigned int) strtoul(tok, &dump,
-                            0);
+                    tail->token.payload.ui = (unsigned int) strtoul(digits,
+                            &dump, base);
                     break;
                 case TKN_INT_L:
-                    tail->token.payload.li = strtol(tok, &dump, 0);
+                    tail->token.payload.li = strtol(digits, &dump, base);
                     break;
                 case TKN_INT_UL:
-                    tail->token.payload.uli = strtoul(tok, &dump, 0);
+                    tail->token.payload.uli = strtoul(digits, &dump, base);
                     break;
                 case TKN_INT_LL:
-                    tail->token.payload.lli = strtoll(tok, &dump, 0);
+                    tail->token.payload.lli = strtoll(digits, &dump, base);
                     break;
                 case TKN_INT_ULL:
-                    tail->token.payload.ulli = strtoull(tok, &dump, 0);
+                    tail->token.payload.ulli = strtoull(digits, &dump, base);
                     break;
                 default:
                     return ERR_PARSE_ERR;
@@ -483,8 +1005,8 @@ errr make_token(char* tok, int type) {
                             strncpy(buf, cur, 3);
                             buf[3] = '\0';
                             tail->token.payload.str_ptr[idx] = (char) strtol(
-                                    buf, &cur, 8);
-                            cur--;
+                                    buf, &pEnd, 8);
+                            cur += pEnd - buf - 1;
                             break;
                         default:
                             return ERR_PARSE_ERR;
@@ -712,7 +1234,7 @@ int get_kwid(char* tok) {
 }
 
 void printhlp() {
-    printf("Usage: dcc-lex [source file] [output file]\n");
+    printf("Usage: dcc-lex [--aos | --soa] [--index[=K]] [--recover] [source file] [output file]\n");
 }
 
 errr init_regex() {
@@ -0,0 +1,98 @@
+/*
+ * token.h
+ *
+ * Token kinds, the token_t record and the output format constants shared
+ * by the lexer and the verifier. See main.c for the output formats.
+ */
+
+#ifndef TOKEN_H_
+#define TOKEN_H_
+
+#define TKN_KEYWD 0
+#define TKN_ID 1
+#define TKN_INT 2
+#define TKN_FLOAT 3
+#define TKN_CHAR 4
+#define TKN_STR 5
+#define TKN_OPER 6
+#define TKN_GROUP 7
+#define TKN_TERM 8
+#define TKN_MAX 9
+#define TKN_ERR 10
+#define TKN_NKINDS 11
+
+#define TKN_INT_STD 0
+#define TKN_INT_U 1
+#define TKN_INT_L 2
+#define TKN_INT_UL 3
+#define TKN_INT_LL 4
+#define TKN_INT_ULL 5
+
+#define TKN_FLOAT_F 0
+#define TKN_FLOAT_D 1
+#define TKN_FLOAT_LD 2
+
+#define TKN_ALNUM_EMB 0
+#define TKN_ALNUM_PTR 1
+
+#define LEXERR_CHAR 0 /* no token pattern matches */
+#define LEXERR_TOKEN 1 /* token matched but could not be converted */
+
+#define SOA_ALIGN 16
+#define INDEX_MAGIC 0x58444944 /* "DIDX" */
+
+typedef struct {
+    unsigned long int off;
+    unsigned long int len;
+} src_span;
+
+typedef struct {
+    int type;
+    int subtype;
+    union {
+        int kwid;
+        char* aid_ptr;
+        char aid_emb[16];
+        int i;
+        unsigned int ui;
+        long int li;
+        unsigned long int uli;
+        long long int lli;
+        unsigned long long int ulli;
+        float f;
+        double d;
+        long double ld;
+        char c;
+        char* str_ptr;
+        char str_emb[16];
+        char op[3];
+        char gr;
+        src_span err;
+    } payload;
+} token_t;
+
+/* State of the stream just before token tok */
+typedef struct {
+    unsigned int tok;
+    unsigned int str_idx;
+    unsigned int str_off;
+    unsigned int pcount[TKN_NKINDS];
+} idx_checkpoint;
+
+/*
+ * Index header. pbase holds the byte offset of each kind's SoA payload
+ * array, and is zero in AoS streams, whose payloads sit in the records.
+ */
+typedef struct {
+    uint64_t tok_base;
+    uint64_t str_base;
+    uint64_t pbase[TKN_NKINDS];
+    unsigned int tok_stride;
+    unsigned int every;
+    unsigned int count;
+    unsigned int ncheck;
+    unsigned int nterm;
+    unsigned int nclose;
+} index_hdr;
+
+#endif /* TOKEN_H_ */
@@ -0,0 +1,1343 @@
+/*
+ * verify.c
+ *
+ * Differential verifier and throughput gate for dcc-lex scanner engines.
+ *
+ * Every round generates random, lexically valid C source covering each TKN_*
+ * kind, every TKN_INT_* and TKN_FLOAT_* suffix spelling and every escape
+ * sequence, together with the tokens it must lex to. The reference engine
+ * (the regexec-based dcc-lex) is checked against those expected tokens, and
+ * every engine given on the command line must then produce byte-identical
+ * output to the reference. Engines take the same options as dcc-lex: every
+ * fourth round injects unrecognizable spans, among them malformed literals
+ * and literals with escapes make_token() rejects, and runs the reference and
+ * every engine with --recover. The reference's
+ * --soa output is decoded as well, and must hold the same tokens, and its
+ * --index output is checked against a recount in both formats.
+ *
+ * Finally every engine is timed on a large input, and the run fails if an
+ * engine's throughput, the reference's included, drops below its own line in
+ * the baseline file, which holds "<MB/s> <engine command>" lines ('#' starts
+ * a comment).
+ *
+ * Usage: dcc-verify [-r rounds] [-s seed] [-b baseline] [-t tolerance] [-w]
+ *                   [engine command ...]
+ */
+
+#define _POSIX_C_SOURCE 200809L
+
+#include <limits.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <sys/wait.h>
+#include <time.h>
+#include <unistd.h>
+
+#include "token.h"
+
+#define REF_ENGINE "./dcc-lex"
+#define RECOVER_OPT "--recover"
+#define VERIFY_ROUNDS 200
+#define VERIFY_TOKENS 400
+#define ERR_ROUND_EVERY 4
+#define BENCH_BYTES (1 << 20)
+#define BENCH_RUNS 5
+#define TOLERANCE_DEF 0.2
+#define LINE_WRAP 100
+#define MAX_GEN_LEN 40
+#define CMD_BUFSIZ 4096
+
+typedef unsigned int uint;
+
+typedef struct {
+    char* s;
+    size_t len;
+    size_t cap;
+} text_buf;
+
+/* A token the input must lex to, and where it came from */
+typedef struct {
+    token_t tok;
+    char* str;
+    size_t off;
+    size_t len;
+} expected;
+
+typedef struct {
+    expected* ex;
+    size_t n;
+    size_t cap;
+} expected_list;
+
+const char* keywords[] = { "auto", "break", "case", "char", "const",
+        "continue", "default", "do", "double", "else", "enum", "extern",
+        "float", "for", "goto", "if", "int", "long", "register", "return",
+        "short", "signed", "sizeof", "static", "struct", "switch", "typedef",
+        "union", "unsigned", "void", "volatile", "while" };
+#define NKEYWORDS ((int) (sizeof(keywords) / sizeof(keywords[0])))
+
+const char* operators[] = { "=", "==", "+", "+=", "*", "*=", "/", "/=", "%",
+        "%=", ">", ">=", "<", "<=", "!", "!=", "~", "~=", "&", "&=", "|", "|=",
+        "^", "^=", "-", "-=", "++", "--", "&&", "||", "<<", "<<=", ">>", ">>=",
+        "->", "?", ":" };
+#define NOPERATORS ((int) (sizeof(operators) / sizeof(operators[0])))
+
+const char* groups = "(),{}[]";
+const char* simple_esc = "abfnrtv\\'\"?";
+const char* simple_val = "\a\b\f\n\r\t\v\\'\"?";
+const char* bad_chars = "@$`";
+const char* bad_esc = "qzcdgkm89";
+/* Let through by REG_ICASE, but rejected by make_token() */
+const char* upper_esc = "ABFNRTVX";
+
+uint64_t rng_state;
+
+/* xorshift64*, so a seed reproduces the same inputs on any libc */
+uint64_t rnd(void) {
+    rng_state ^= rng_state >> 12;
+    rng_state ^= rng_state << 25;
+    rng_state ^= rng_state >> 27;
+    return rng_state * 2685821657736338717ULL;
+}
+
+uint rnd_below(uint n) {
+    return (uint) (rnd() % n);
+}
+
+void put_char(text_buf* t, char c) {
+    if (t->len + 1 >= t->cap) {
+        t->cap = t->cap ? t->cap * 2 : 4096;
+        t->s = (char*) realloc(t->s, t->cap);
+        if (!t->s) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+    }
+    t->s[t->len++] = c;
+    t->s[t->len] = '\0';
+}
+
+void put_str(text_buf* t, const char* s) {
+    while (*s) {
+        put_char(t, *s++);
+    }
+}
+
+expected* add_expected(expected_list* l) {
+    if (l->n == l->cap) {
+        l->cap = l->cap ? l->cap * 2 : 256;
+        l->ex = (expected*) realloc(l->ex, l->cap * sizeof(expected));
+        if (!l->ex) {
+            fprintf(stderr, "Out of memory\n");
+            exit(1);
+        }
+    }
+    expected* e = &l->ex[l->n++];
+    memset(e, 0, sizeof(expected));
+    return e;
+}
+
+void free_expected(expected_list* l) {
+    for (size_t i = 0; i < l->n; i++) {
+        free(l->ex[i].str);
+    }
+    l->n = 0;
+}
+
+int is_keyword(const char* s) {
+    /* The lexer matches keywords case-insensitively */
+    for (int i = 0; i < NKEYWORDS; i++) {
+        if (!strcasecmp(s, keywords[i])) return 1;
+    }
+    return 0;
+}
+
+void gen_id(text_buf* t, expected* e) {
+    static const char* first =
+            "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_";
+    static const char* rest =
+            "abcdefghijklmnopqrstuvwxyzABCDEFGHIJKLMNOPQRSTUVWXYZ_0123456789";
+    char id[MAX_GEN_LEN + 1];
+    do {
+        uint len = 1 + rnd_below(MAX_GEN_LEN);
+        id[0] = first[rnd_below(strlen(first))];
+        for (uint i = 1; i < len; i++) {
+            id[i] = rest[rnd_below(strlen(rest))];
+        }
+        id[len] = '\0';
+    } while (is_keyword(id));
+    put_str(t, id);
+    e->tok.type = TKN_ID;
+    e->tok.subtype = (strlen(id) < 16) ? TKN_ALNUM_EMB : TKN_ALNUM_PTR;
+    e->str = strdup(id);
+}
+
+void gen_int(text_buf* t, expected* e) {
+    static const unsigned long long max[] = { INT_MAX, UINT_MAX, LONG_MAX,
+            ULONG_MAX, LLONG_MAX, ULLONG_MAX };
+    static const char* u_sfx[] = { "u", "U" };
+    static const char* l_sfx[] = { "l", "L" };
+    static const char* ll_sfx[] = { "ll", "LL" };
+    char buf[64];
+    int st = rnd_below(6);
+    /* Favour short values, but reach the top of every range */
+    unsigned long long v = rnd() >> rnd_below(64);
+    if (v > max[st]) v &= max[st];
+    switch (rnd_below(4)) {
+        case 0:
+            sprintf(buf, "%llu", v);
+            break;
+        case 1:
+            sprintf(buf, "0%llo", v);
+            break;
+        case 2:
+            sprintf(buf, rnd_below(2) ? "0x%llx" : "0X%llX", v);
+            break;
+        default: {
+            int n = 0;
+            char* cp = buf + sprintf(buf, rnd_below(2) ? "0b" : "0B");
+            while ((v >> n) > 1) n++;
+            for (; n >= 0; n--) *cp++ = '0' + ((v >> n) & 1);
+            *cp = '\0';
+            break;
+        }
+    }
+    if (st & 1) strcat(buf, u_sfx[rnd_below(2)]);
+    if ((st == TKN_INT_L) || (st == TKN_INT_UL)) strcat(buf,
+            l_sfx[rnd_below(2)]);
+    if ((st == TKN_INT_LL) || (st == TKN_INT_ULL)) strcat(buf,
+            ll_sfx[rnd_below(2)]);
+    put_str(t, buf);
+    e->tok.type = TKN_INT;
+    e->tok.subtype = st;
+    switch (st) {
+        case TKN_INT_STD:
+            e->tok.payload.i = (int) v;
+            break;
+        case TKN_INT_U:
+            e->tok.payload.ui = (unsigned int) v;
+            break;
+        case TKN_INT_L:
+            e->tok.payload.li = (long int) v;
+            break;
+        case TKN_INT_UL:
+            e->tok.payload.uli = (unsigned long int) v;
+            break;
+        case TKN_INT_LL:
+            e->tok.payload.lli = (long long int) v;
+            break;
+        default:
+            e->tok.payload.ulli = v;
+            break;
+    }
+}
+
+void put_digits(char* buf, uint min, uint max) {
+    uint n = min + rnd_below(max - min + 1);
+    buf += strlen(buf);
+    for (uint i = 0; i < n; i++) {
+        *buf++ = '0' + rnd_below(10);
+    }
+    *buf = '\0';
+}
+
+void put_exponent(char* buf) {
+    static const char* signs[] = { "", "+", "-" };
+    strcat(buf, rnd_below(2) ? "e" : "E");
+    strcat(buf, signs[rnd_below(3)]);
+    put_digits(buf, 1, 2);
+}
+
+/*
+ * The reference accepts a suffix only on the exponent-without-point form,
+ * and requires one there; the point forms are always TKN_FLOAT_D.
+ */
+void gen_float(text_buf* t, expected* e) {
+    char buf[64] = "";
+    char sfx = '\0';
+    switch (rnd_below(3)) {
+        case 0:
+            put_digits(buf, 1, 6);
+            strcat(buf, ".");
+            put_digits(buf, 0, 6);
+            if (rnd_below(2)) put_exponent(buf);
+            break;
+        case 1:
+            strcat(buf, ".");
+            put_digits(buf, 1, 6);
+            if (rnd_below(2)) put_exponent(buf);
+            break;
+        default:
+            put_digits(buf, 1, 6);
+            put_exponent(buf);
+            sfx = "FfLl"[rnd_below(4)];
+            break;
+    }
+    e->tok.type = TKN_FLOAT;
+    switch (sfx) {
+        case 'F':
+        case 'f':
+            e->tok.subtype = TKN_FLOAT_F;
+            e->tok.payload.f = strtof(buf, NULL);
+            break;
+        case 'L':
+        case 'l':
+            e->tok.subtype = TKN_FLOAT_LD;
+            e->tok.payload.ld = strtold(buf, NULL);
+            break;
+        default:
+            e->tok.subtype = TKN_FLOAT_D;
+            e->tok.payload.d = strtod(buf, NULL);
+            break;
+    }
+    put_str(t, buf);
+    if (sfx) put_char(t, sfx);
+}
+
+#define ESC_PLAIN 0
+#define ESC_OCT 1
+#define ESC_HEX 2
+
+/*
+ * Write one character of a character or string literal delimited by quote,
+ * plain or escaped, and return its value. The item's kind is stored in kind;
+ * after is the previous item's kind, since a short octal escape or a hex
+ * escape must not be followed by a digit it would absorb.
+ */
+char gen_lit_char(text_buf* t, char quote, int after, int nonzero,
+        int* kind) {
+    char buf[8];
+    for (;;) {
+        uint v;
+        switch (rnd_below(6)) {
+            case 0: {
+                uint i = rnd_below(strlen(simple_esc));
+                put_char(t, '\\');
+                put_char(t, simple_esc[i]);
+                *kind = ESC_PLAIN;
+                return simple_val[i];
+            }
+            case 1: {
+                uint digits = 1 + rnd_below(3);
+                v = rnd_below((digits < 3) ? 1 << (3 * digits) : 0400);
+                if (nonzero && !v) continue;
+                sprintf(buf, "\\%0*o", (int) digits, v);
+                put_str(t, buf);
+                *kind = (digits < 3) ? ESC_OCT : ESC_PLAIN;
+                return (char) v;
+            }
+            case 2:
+                v = rnd_below(256);
+                if (nonzero && !v) continue;
+                sprintf(buf, (v < 16) ? "\\x%x" : "\\x%02X", v);
+                put_str(t, buf);
+                *kind = ESC_HEX;
+                return (char) v;
+            default:
+                v = 0x20 + rnd_below(0x5f);
+                if ((v == (uint) quote) || (v == '\\')) continue;
+                if ((after == ESC_OCT) && (v >= '0') && (v <= '7')) continue;
+                if ((after == ESC_HEX) && strchr("0123456789abcdefABCDEF",
+                        (int) v)) continue;
+                put_char(t, (char) v);
+                *kind = ESC_PLAIN;
+                return (char) v;
+        }
+    }
+}
+
+void gen_char(text_buf* t, expected* e) {
+    int kind;
+    put_char(t, '\'');
+    e->tok.type = TKN_CHAR;
+    e->tok.payload.c = gen_lit_char(t, '\'', ESC_PLAIN, 0, &kind);
+    put_char(t, '\'');
+}
+
+/* NUL escapes are left out, as the string payload is NUL-terminated */
+void gen_str(text_buf* t, expected* e) {
+    char s[MAX_GEN_LEN + 1];
+    uint len = rnd_below(MAX_GEN_LEN + 1);
+    int kind = ESC_PLAIN;
+    put_char(t, '"');
+    for (uint i = 0; i < len; i++) {
+        s[i] = gen_lit_char(t, '"', kind, 1, &kind);
+    }
+    s[len] = '\0';
+    put_char(t, '"');
+    e->tok.type = TKN_STR;
+    e->tok.subtype = (len < 16) ? TKN_ALNUM_EMB : TKN_ALNUM_PTR;
+    e->str = strdup(s);
+}
+
+/*
+ * An unrecognizable span: a run of stray characters, or a literal with an
+ * unknown escape, which --recover must skip as a whole even though it
+ * contains ';' and '{'. Both are LEXERR_CHAR. A literal with an upper-case
+ * escape matches its pattern, and is then rejected as a LEXERR_TOKEN.
+ */
+void gen_err(text_buf* t, expected* e) {
+    uint variant = rnd_below(3);
+    e->tok.type = TKN_ERR;
+    e->tok.subtype = LEXERR_CHAR;
+    if (variant == 2) {
+        char quote = rnd_below(2) ? '"' : '\'';
+        char esc[4] = "\\";
+        int kind = ESC_PLAIN;
+        esc[1] = upper_esc[rnd_below(strlen(upper_esc))];
+        if (esc[1] == 'X') esc[2] = "0123456789ABCDEFabcdef"[rnd_below(22)];
+        put_char(t, quote);
+        if (quote == '"') {
+            for (uint i = rnd_below(4); i > 0; i--) {
+                gen_lit_char(t, quote, kind, 0, &kind);
+            }
+        }
+        put_str(t, esc);
+        if (quote == '"') {
+            kind = (esc[1] == 'X') ? ESC_HEX : ESC_PLAIN;
+            for (uint i = rnd_below(4); i > 0; i--) {
+                gen_lit_char(t, quote, kind, 0, &kind);
+            }
+        }
+        put_char(t, quote);
+        e->tok.subtype = LEXERR_TOKEN;
+    } else if (variant) {
+        uint len = 1 + rnd_below(3);
+        for (uint i = 0; i < len; i++) {
+            put_char(t, bad_chars[rnd_below(strlen(bad_chars))]);
+        }
+    } else {
+        static const char* fill = "ab;{} ";
+        char quote = rnd_below(2) ? '"' : '\'';
+        char body[8] = ";{";
+        body[2] = '\\';
+        body[3] = bad_esc[rnd_below(strlen(bad_esc))];
+        for (uint i = 4; i < 7; i++) {
+            body[i] = fill[rnd_below(strlen(fill))];
+        }
+        body[7] = '\0';
+        /* Shuffle, keeping the escape pair together */
+        for (uint i = 0; i < 6; i++) {
+            uint j = rnd_below(7);
+            if ((i == 2) || (i == 3) || (j == 2) || (j == 3)) continue;
+            char c = body[i];
+            body[i] = body[j];
+            body[j] = c;
+        }
+        put_char(t, quote);
+        put_str(t, body);
+        put_char(t, quote);
+    }
+}
+
+int is_ident_char(char c) {
+    return ((c >= 'a') && (c <= 'z')) || ((c >= 'A') && (c <= 'Z'))
+            || ((c >= '0') && (c <= '9')) || (c == '_');
+}
+
+/*
+ * Whether the text of a token of kind nkind, written right after one of
+ * kind pkind, would lex differently than the two tokens apart.
+ */
+int would_merge(int pkind, const char* ptext, int nkind, const char* ntext) {
+    switch (pkind) {
+        case TKN_KEYWD:
+        case TKN_ID:
+            return is_ident_char(*ntext);
+        case TKN_INT:
+        case TKN_FLOAT:
+            /* Also "1" ".5", which is the float "1.5" */
+            return is_ident_char(*ntext) || (*ntext == '.');
+        case TKN_OPER:
+            if (nkind != TKN_OPER) return 0;
+            /* The operator would grow if a longer one is a prefix of both */
+            for (int i = 0; i < NOPERATORS; i++) {
+                size_t plen = strlen(ptext);
+                size_t len = strlen(operators[i]);
+                if ((len > plen) && !strncmp(operators[i], ptext, plen)
+                        && !strncmp(operators[i] + plen, ntext, len - plen)) {
+                    return 1;
+                }
+            }
+            return 0;
+        case TKN_ERR:
+            /* Resynchronization runs on until a recognizable token */
+            return nkind == TKN_ERR;
+        default:
+            return 0;
+    }
+}
+
+/*
+ * Append ntok random tokens to t and record them in l. Tokens touch unless
+ * they would merge, so the scanner's token boundaries and longest-match
+ * choices are exercised. With errors set, unrecognizable spans are mixed
+ * in. Returns the number of such spans.
+ */
+uint gen_input(text_buf* t, expected_list* l, uint ntok, int errors) {
+    text_buf tok = { NULL, 0, 0 };
+    int pkind = TKN_TERM;
+    char* ptext = NULL;
+    size_t line_start = t->len;
+    uint nerr = 0;
+    for (uint i = 0; i < ntok; i++) {
+        expected* e = add_expected(l);
+        int kind = rnd_below(errors ? TKN_MAX + 1 : TKN_MAX);
+        tok.len = 0;
+        switch (kind) {
+            case TKN_KEYWD:
+                e->tok.type = TKN_KEYWD;
+                e->tok.payload.kwid = rnd_below(NKEYWORDS);
+                put_str(&tok, keywords[e->tok.payload.kwid]);
+                break;
+            case TKN_ID:
+                gen_id(&tok, e);
+                break;
+            case TKN_INT:
+                gen_int(&tok, e);
+                break;
+            case TKN_FLOAT:
+                gen_float(&tok, e);
+                break;
+            case TKN_CHAR:
+                gen_char(&tok, e);
+                break;
+            case TKN_STR:
+                gen_str(&tok, e);
+                break;
+            case TKN_OPER: {
+                const char* op = operators[rnd_below(NOPERATORS)];
+                e->tok.type = TKN_OPER;
+                strncpy(e->tok.payload.op, op, 3);
+                put_str(&tok, op);
+                break;
+            }
+            case TKN_GROUP:
+                e->tok.type = TKN_GROUP;
+                e->tok.payload.gr = groups[rnd_below(strlen(groups))];
+                put_char(&tok, e->tok.payload.gr);
+                break;
+            case TKN_TERM:
+                e->tok.type = TKN_TERM;
+                put_char(&tok, ';');
+                break;
+            default:
+                gen_err(&tok, e);
+                nerr++;
+                break;
+        }
+        kind = e->tok.type;
+        /*
+         * Blanks only where needed or now and then, keeping lines well
+         * inside the lexer's line buffer
+         */
+        if (t->len - line_start > LINE_WRAP) {
+            put_char(t, '\n');
+            line_start = t->len;
+        } else if (ptext && (would_merge(pkind, ptext, kind, tok.s)
+                || !rnd_below(8))) {
+            put_char(t, " \t"[rnd_below(2)]);
+        }
+        e->off = t->len;
+        e->len = tok.len;
+        if (kind == TKN_ERR) {
+            e->tok.payload.err.off = e->off;
+            e->tok.payload.err.len = e->len;
+        }
+        put_str(t, tok.s);
+        free(ptext);
+        ptext = strdup(tok.s);
+        pkind = kind;
+    }
+    put_char(t, '\n');
+    free(ptext);
+    free(tok.s);
+    return nerr;
+}
+
+int read_file(const char* path, char** data, size_t* len) {
+    FILE* f = fopen(path, "rb");
+    if (!f) return 1;
+    size_t cap = 4096;
+    *len = 0;
+    *data = (char*) malloc(cap);
+    while (*data) {
+        *len += fread(*data + *len, 1, cap - *len, f);
+        if (*len < cap) break;
+        cap *= 2;
+        *data = (char*) realloc(*data, cap);
+    }
+    fclose(f);
+    return !*data;
+}
+
+int write_file(const char* path, text_buf* t) {
+    FILE* f = fopen(path, "wb");
+    if (!f) return 1;
+    fwrite(t->s, 1, t->len, f);
+    return fclose(f) != 0;
+}
+
+/* Run engine on in, writing to out; returns its exit status or -1 */
+int run_engine(const char* engine, const char* in, const char* out) {
+    char cmd[2 * CMD_BUFSIZ];
+    snprintf(cmd, 2 * CMD_BUFSIZ, "%s '%s' '%s' >/dev/null 2>&1", engine, in,
+            out);
+    int status = system(cmd);
+    if ((status == -1) || !WIFEXITED(status)) return -1;
+    return WEXITSTATUS(status);
+}
+
+void print_expected(text_buf* t, expected* e) {
+    fprintf(stderr, "  source at offset %lu: '%.*s'\n",
+            (unsigned long) e->off, (int) e->len, t->s + e->off);
+}
+
+/* Compare one decoded token against its expectation; 0 if they agree */
+int check_token(expected* e, token_t* got, const char* gotstr) {
+    if ((got->type != e->tok.type) || (got->subtype != e->tok.subtype)) {
+        return 1;
+    }
+    switch (e->tok.type) {
+        case TKN_KEYWD:
+            return got->payload.kwid != e->tok.payload.kwid;
+        case TKN_ID:
+        case TKN_STR:
+            return !gotstr || strcmp(gotstr, e->str);
+        case TKN_INT:
+            switch (e->tok.subtype) {
+                case TKN_INT_STD:
+                    return got->payload.i != e->tok.payload.i;
+                case TKN_INT_U:
+                    return got->payload.ui != e->tok.payload.ui;
+                case TKN_INT_L:
+                    return got->payload.li != e->tok.payload.li;
+                case TKN_INT_UL:
+                    return got->payload.uli != e->tok.payload.uli;
+                case TKN_INT_LL:
+                    return got->payload.lli != e->tok.payload.lli;
+                default:
+                    return got->payload.ulli != e->tok.payload.ulli;
+            }
+        case TKN_FLOAT:
+            switch (e->tok.subtype) {
+                case TKN_FLOAT_F:
+                    return got->payload.f != e->tok.payload.f;
+                case TKN_FLOAT_D:
+                    return got->payload.d != e->tok.payload.d;
+                default:
+                    return got->payload.ld != e->tok.payload.ld;
+            }
+        case TKN_CHAR:
+            return got->payload.c != e->tok.payload.c;
+        case TKN_OPER:
+            return memcmp(got->payload.op, e->tok.payload.op, 3);
+        case TKN_GROUP:
+            return got->payload.gr != e->tok.payload.gr;
+        case TKN_ERR:
+            return (got->payload.err.off != e->tok.payload.err.off)
+                    || (got->payload.err.len != e->tok.payload.err.len);
+        default:
+            return 0;
+    }
+}
+
+/* The tokens of an output stream, in either format */
+typedef struct {
+    token_t* tok;
+    const char** str;
+    size_t n;
+    size_t size;
+} decoded_stream;
+
+void free_decoded(decoded_stream* d) {
+    free(d->tok);
+    free(d->str);
+    memset(d, 0, sizeof(decoded_stream));
+}
+
+int alloc_decoded(decoded_stream* d, size_t n) {
+    d->n = n;
+    d->tok = (token_t*) calloc(n + 1, sizeof(token_t));
+    d->str = (const char**) calloc(n + 1, sizeof(char*));
+    return !d->tok || !d->str;
+}
+
+/* Decode a token_t stream; 0 if it is well-formed */
+int decode_aos(const char* data, size_t len, decoded_stream* d) {
+    size_t ntok = 0;
+    while (((ntok + 1) * sizeof(token_t) <= len)
+            && (((const token_t*) data)[ntok].type != TKN_MAX)) {
+        ntok++;
+    }
+    if ((ntok + 1) * sizeof(token_t) > len) {
+        fprintf(stderr, "Token stream has no sentinel\n");
+        return 1;
+    }
+    if (alloc_decoded(d, ntok)) return 1;
+    const char* str = data + (ntok + 1) * sizeof(token_t);
+    const char* end = data + len;
+    for (size_t i = 0; i < ntok; i++) {
+        token_t* got = &d->tok[i];
+        memcpy(got, data + i * sizeof(token_t), sizeof(token_t));
+        if (((got->type == TKN_ID) || (got->type == TKN_STR))
+                && (got->subtype == TKN_ALNUM_PTR)) {
+            if (str < end) {
+                d->str[i] = str;
+                str += strnlen(str, end - str) + 1;
+            }
+        } else if ((got->type == TKN_ID) || (got->type == TKN_STR)) {
+            got->payload.aid_emb[15] = '\0';
+            d->str[i] = got->payload.aid_emb;
+        }
+    }
+    d->size = (str < end) ? (size_t) (str - data) : len;
+    return 0;
+}
+
+/*
+ * Claim a section of bytes at *pos of an SoA stream, check that it and its
+ * zero padding to SOA_ALIGN fit in len, and advance *pos past both.
+ */
+int soa_section(const char* data, size_t len, size_t* pos, size_t bytes,
+        size_t* start) {
+    size_t end = *pos + bytes;
+    size_t padded = (end + SOA_ALIGN - 1) / SOA_ALIGN * SOA_ALIGN;
+    if (padded > len) {
+        fprintf(stderr, "SoA section at byte %lu overruns the stream\n",
+                (unsigned long) *pos);
+        return 1;
+    }
+    for (size_t i = end; i < padded; i++) {
+        if (data[i]) {
+            fprintf(stderr, "SoA padding at byte %lu is not zero\n",
+                    (unsigned long) i);
+            return 1;
+        }
+    }
+    *start = *pos;
+    *pos = padded;
+    return 0;
+}
+
+/* Payload element size of each kind in the SoA layout */
+const size_t soa_size[TKN_NKINDS] = { 1, sizeof(unsigned int),
+        sizeof(unsigned long long), sizeof(long double), 1,
+        sizeof(unsigned int), 3, 1, 0, 0, sizeof(src_span) };
+/* Order of the SoA payload arrays, as written by write_soa() */
+const int soa_order[] = { TKN_FLOAT, TKN_ERR, TKN_INT, TKN_ID, TKN_STR,
+        TKN_OPER, TKN_KEYWD, TKN_CHAR, TKN_GROUP };
+#define NSOA_ARRAYS ((int) (sizeof(soa_order) / sizeof(soa_order[0])))
+
+/*
+ * Decode an SoA stream into token_t records; 0 if it is well-formed. The
+ * payload array bases are stored in pbase and the string pool's in
+ * str_base, when not NULL.
+ */
+int decode_soa(const char* data, size_t len, decoded_stream* d,
+        size_t* pbase, size_t* str_base) {
+    unsigned int hdr[TKN_NKINDS + 2];
+    size_t pos = 0, start, kind, subtype, base[TKN_NKINDS], pool;
+    if (soa_section(data, len, &pos, sizeof(hdr), &start)) return 1;
+    memcpy(hdr, data, sizeof(hdr));
+    unsigned int count = hdr[0];
+    unsigned int* pcount = hdr + 1;
+    unsigned int pool_len = hdr[TKN_NKINDS + 1];
+    if (soa_section(data, len, &pos, count + 1, &kind)
+            || soa_section(data, len, &pos, count + 1, &subtype)) return 1;
+    memset(base, 0, sizeof(base));
+    for (int i = 0; i < NSOA_ARRAYS; i++) {
+        int k = soa_order[i];
+        if (soa_section(data, len, &pos, (size_t) pcount[k] * soa_size[k],
+                &base[k])) return 1;
+    }
+    if (soa_section(data, len, &pos, pool_len, &pool)) return 1;
+    if ((pool_len && data[pool + pool_len - 1]) || (unsigned char) data[kind
+            + count] != TKN_MAX) {
+        fprintf(stderr, "SoA stream lacks its sentinel or pool terminator\n");
+        return 1;
+    }
+    if (alloc_decoded(d, count)) return 1;
+    d->size = pos;
+    unsigned int pidx[TKN_NKINDS] = { 0 };
+    size_t next_str = 0;
+    for (size_t i = 0; i < count; i++) {
+        token_t* got = &d->tok[i];
+        int k = (unsigned char) data[kind + i];
+        if ((k >= TKN_NKINDS) || (k == TKN_MAX) || (pidx[k] >= pcount[k]
+                && soa_size[k])) {
+            fprintf(stderr, "SoA token %lu has bad kind %d or no payload\n",
+                    (unsigned long) i, k);
+            return 1;
+        }
+        const char* p = data + base[k] + pidx[k]++ * soa_size[k];
+        got->type = k;
+        got->subtype = (unsigned char) data[subtype + i];
+        switch (k) {
+            case TKN_KEYWD:
+                got->payload.kwid = *(const signed char*) p;
+                break;
+            case TKN_ID:
+            case TKN_STR: {
+                unsigned int off;
+                memcpy(&off, p, sizeof(off));
+                /* Strings are pooled back to back, in token order */
+                if ((off != next_str) || (off >= pool_len)) {
+                    fprintf(stderr, "SoA token %lu has strpool offset %u,"
+                            " expected %lu\n", (unsigned long) i, off,
+                            (unsigned long) next_str);
+                    return 1;
+                }
+                d->str[i] = data + pool + off;
+                next_str = off + strlen(d->str[i]) + 1;
+                break;
+            }
+            case TKN_INT: {
+                unsigned long long v;
+                memcpy(&v, p, sizeof(v));
+                switch (got->subtype) {
+                    case TKN_INT_STD:
+                        got->payload.i = (int) v;
+                        break;
+                    case TKN_INT_U:
+                        got->payload.ui = (unsigned int) v;
+                        break;
+                    case TKN_INT_L:
+                        got->payload.li = (long int) v;
+                        break;
+                    case TKN_INT_UL:
+                        got->payload.uli = (unsigned long int) v;
+                        break;
+                    case TKN_INT_LL:
+                        got->payload.lli = (long long int) v;
+                        break;
+                    default:
+                        got->payload.ulli = v;
+                        break;
+                }
+                break;
+            }
+            case TKN_FLOAT: {
+                long double v;
+                memcpy(&v, p, sizeof(v));
+                if (got->subtype == TKN_FLOAT_F) got->payload.f = (float) v;
+                else if (got->subtype == TKN_FLOAT_D) got->payload.d = v;
+                else got->payload.ld = v;
+                break;
+            }
+            case TKN_CHAR:
+                got->payload.c = *p;
+                break;
+            case TKN_OPER:
+                memcpy(got->payload.op, p, 3);
+                break;
+            case TKN_GROUP:
+                got->payload.gr = *p;
+                break;
+            case TKN_ERR:
+                memcpy(&got->payload.err, p, sizeof(src_span));
+                break;
+            default:
+                break;
+        }
+    }
+    for (int k = 0; k < TKN_NKINDS; k++) {
+        if (pidx[k] != pcount[k]) {
+            fprintf(stderr, "SoA pcount[%d] is %u, but %u tokens have that"
+                    " kind\n", k, pcount[k], pidx[k]);
+            return 1;
+        }
+    }
+    if (next_str != pool_len) {
+        fprintf(stderr, "SoA strpool has %u bytes, tokens use %lu\n",
+                pool_len, (unsigned long) next_str);
+        return 1;
+    }
+    if (pbase) memcpy(pbase, base, sizeof(base));
+    if (str_base) *str_base = pool;
+    return 0;
+}
+
+/* Check decoded tokens against want; 0 if they match */
+int check_decoded(decoded_stream* d, expected_list* want, text_buf* t) {
+    for (size_t i = 0; i < d->n && i < want->n; i++) {
+        token_t* got = &d->tok[i];
+        if (check_token(&want->ex[i], got, d->str[i])) {
+            fprintf(stderr, "Token %lu: got kind %d/%d, expected %d/%d\n",
+                    (unsigned long) i, got->type, got->subtype,
+                    want->ex[i].tok.type, want->ex[i].tok.subtype);
+            if (t) print_expected(t, &want->ex[i]);
+            return 1;
+        }
+    }
+    if (d->n != want->n) {
+        fprintf(stderr, "Got %lu tokens, expected %lu\n",
+                (unsigned long) d->n, (unsigned long) want->n);
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Check the reference's --soa output for in against the AoS decode aos,
+ * token by token; 0 if they agree.
+ */
+int check_soa(const char* in, const char* out, const char* opts, int status,
+        decoded_stream* aos) {
+    char cmd[CMD_BUFSIZ];
+    char* data = NULL;
+    size_t len;
+    decoded_stream soa = { NULL, NULL, 0, 0 };
+    expected_list want = { NULL, 0, 0 };
+    int failed = 1;
+    snprintf(cmd, CMD_BUFSIZ, "%s --soa%s", REF_ENGINE, opts);
+    if (run_engine(cmd, in, out) != status) {
+        fprintf(stderr, "'%s' exited with an unexpected status\n", cmd);
+    } else if (read_file(out, &data, &len)) {
+        fprintf(stderr, "Cannot read %s\n", out);
+    } else if (!decode_soa(data, len, &soa, NULL, NULL)) {
+        if (soa.size != len) {
+            fprintf(stderr, "SoA stream is %lu bytes, output %lu\n",
+                    (unsigned long) soa.size, (unsigned long) len);
+        } else {
+            /* The AoS decode, as expectations */
+            for (size_t i = 0; i < aos->n; i++) {
+                expected* e = add_expected(&want);
+                e->tok = aos->tok[i];
+                e->str = aos->str[i] ? strdup(aos->str[i]) : NULL;
+            }
+            failed = check_decoded(&soa, &want, NULL);
+            free_expected(&want);
+            free(want.ex);
+        }
+    }
+    if (failed) fprintf(stderr, "'%s' disagrees with the AoS output\n", cmd);
+    free_decoded(&soa);
+    free(data);
+    return failed;
+}
+
+/*
+ * Check the index of an --index=every output data, whose token stream is
+ * in SoA layout if soa is set, against the tokens of the AoS decode aos;
+ * 0 if it is consistent.
+ */
+int check_index_data(const char* data, size_t len, int soa, uint every,
+        decoded_stream* aos, const char* refdata, size_t reflen) {
+    uint64_t off;
+    unsigned int magic;
+    index_hdr hdr;
+    size_t pbase[TKN_NKINDS], str_base = 0;
+    decoded_stream d = { NULL, NULL, 0, 0 };
+    if (len < 12) return 1;
+    memcpy(&off, data + len - 12, sizeof(off));
+    memcpy(&magic, data + len - 4, sizeof(magic));
+    if ((magic != INDEX_MAGIC) || (off % SOA_ALIGN)
+            || (off + sizeof(index_hdr) > len - 12)) {
+        fprintf(stderr, "Index footer is bad: magic %x, offset %lu\n", magic,
+                (unsigned long) off);
+        return 1;
+    }
+    /* The stream before the index must be the plain output, padded */
+    if (soa) {
+        int bad = decode_soa(data, off, &d, pbase, &str_base)
+                || (d.size != off) || (d.n != aos->n);
+        free_decoded(&d);
+        if (bad) {
+            fprintf(stderr, "SoA stream before the index is bad\n");
+            return 1;
+        }
+    } else {
+        int bad = (reflen > off) || (off - reflen >= SOA_ALIGN)
+                || memcmp(data, refdata, reflen);
+        for (size_t i = reflen; !bad && (i < off); i++) {
+            bad = data[i] != 0;
+        }
+        if (bad) {
+            fprintf(stderr, "AoS stream before the index differs from the"
+                    " plain output\n");
+            return 1;
+        }
+        memset(pbase, 0, sizeof(pbase));
+        str_base = (aos->n + 1) * sizeof(token_t);
+    }
+    memcpy(&hdr, data + off, sizeof(index_hdr));
+    uint64_t tok_base = soa ? ((TKN_NKINDS + 2) * sizeof(unsigned int)
+            + SOA_ALIGN - 1) / SOA_ALIGN * SOA_ALIGN : 0;
+    int bad = (hdr.every != every) || (hdr.count != aos->n)
+            || (hdr.ncheck != (aos->n + every - 1) / every)
+            || (hdr.tok_base != tok_base) || (hdr.str_base != str_base)
+            || (hdr.tok_stride != (soa ? 1 : sizeof(token_t)));
+    for (int k = 0; k < TKN_NKINDS; k++) {
+        bad |= hdr.pbase[k] != pbase[k];
+    }
+    if (bad) {
+        fprintf(stderr, "Index header disagrees with the stream\n");
+        return 1;
+    }
+    /* Sections, each padded to SOA_ALIGN, then the footer */
+    size_t pos = off, check, term, close;
+    if (soa_section(data, len - 12, &pos, sizeof(index_hdr), &check)
+            || soa_section(data, len - 12, &pos,
+                    hdr.ncheck * sizeof(idx_checkpoint), &check)
+            || soa_section(data, len - 12, &pos,
+                    hdr.nterm * sizeof(unsigned int), &term)
+            || soa_section(data, len - 12, &pos,
+                    hdr.nclose * sizeof(unsigned int), &close)
+            || (pos != len - 12)) {
+        fprintf(stderr, "Index sections do not fill the index\n");
+        return 1;
+    }
+    /* Recount every checkpoint and the top-level ';' and '}' tokens */
+    idx_checkpoint state, got;
+    memset(&state, 0, sizeof(state));
+    uint depth = 0, nterm = 0, nclose = 0;
+    for (size_t i = 0; i < aos->n; i++) {
+        token_t* t = &aos->tok[i];
+        unsigned int pos_tok;
+        if (!(i % every)) {
+            memcpy(&got, data + check + i / every * sizeof(idx_checkpoint),
+                    sizeof(got));
+            if (memcmp(&got, &state, sizeof(got))) {
+                fprintf(stderr, "Index checkpoint at token %lu is wrong\n",
+                        (unsigned long) i);
+                return 1;
+            }
+        }
+        if ((t->type == TKN_TERM) && !depth) {
+            if (nterm >= hdr.nterm) break;
+            memcpy(&pos_tok, data + term + nterm++ * sizeof(pos_tok),
+                    sizeof(pos_tok));
+            if (pos_tok != i) {
+                fprintf(stderr, "Index term[%u] is %u; token %lu is the"
+                        " top-level ';'\n", nterm - 1, pos_tok,
+                        (unsigned long) i);
+                return 1;
+            }
+        } else if ((t->type == TKN_GROUP) && (t->payload.gr == '{')) {
+            depth++;
+        } else if ((t->type == TKN_GROUP) && (t->payload.gr == '}')
+                && depth && !--depth) {
+            if (nclose >= hdr.nclose) break;
+            memcpy(&pos_tok, data + close + nclose++ * sizeof(pos_tok),
+                    sizeof(pos_tok));
+            if (pos_tok != i) {
+                fprintf(stderr, "Index close[%u] is %u; token %lu closes to"
+                        " depth zero\n", nclose - 1, pos_tok,
+                        (unsigned long) i);
+                return 1;
+            }
+        }
+        if (((t->type == TKN_ID) || (t->type == TKN_STR))
+                && (soa || (t->subtype == TKN_ALNUM_PTR))) {
+            state.str_idx++;
+            state.str_off += strlen(aos->str[i]) + 1;
+        }
+        state.pcount[t->type]++;
+        state.tok++;
+    }
+    if ((nterm != hdr.nterm) || (nclose != hdr.nclose)) {
+        fprintf(stderr, "Index lists %u ';' and %u '}', stream has %u and"
+                " %u\n", hdr.nterm, hdr.nclose, nterm, nclose);
+        return 1;
+    }
+    return 0;
+}
+
+/*
+ * Run the reference with a random --index in both formats and check the
+ * indexes; 0 if they are consistent.
+ */
+int check_index(const char* in, const char* out, const char* opts,
+        int status, decoded_stream* aos, const char* refdata, size_t reflen) {
+    uint every = 1 + rnd_below(64);
+    for (int soa = 0; soa < 2; soa++) {
+        char cmd[CMD_BUFSIZ];
+        char* data = NULL;
+        size_t len;
+        int failed = 1;
+        snprintf(cmd, CMD_BUFSIZ, "%s%s --index=%u%s", REF_ENGINE,
+                soa ? " --soa" : "", every, opts);
+        if (run_engine(cmd, in, out) != status) {
+            fprintf(stderr, "'%s' exited with an unexpected status\n", cmd);
+        } else if (read_file(out, &data, &len)) {
+            fprintf(stderr, "Cannot read %s\n", out);
+        } else {
+            failed = check_index_data(data, len, soa, every, aos, refdata,
+                    reflen);
+        }
+        free(data);
+        if (failed) {
+            fprintf(stderr, "'%s' wrote a bad index\n", cmd);
+            return 1;
+        }
+    }
+    return 0;
+}
+
+/* Byte-compare an engine's output with the reference's; 0 if identical */
+int diff_streams(const char* engine, const char* ref, size_t reflen,
+        const char* got, size_t gotlen, expected_list* l, text_buf* t) {
+    size_t i = 0;
+    while ((i < reflen) && (i < gotlen) && (ref[i] == got[i])) {
+        i++;
+    }
+    if ((i == reflen) && (i == gotlen)) return 0;
+    fprintf(stderr, "Engine '%s' differs from the reference at byte %lu"
+            " (%lu bytes of output, reference %lu)\n", engine,
+            (unsigned long) i, (unsigned long) gotlen, (unsigned long) reflen);
+    if (i / sizeof(token_t) < l->n) {
+        fprintf(stderr, "  in token %lu\n",
+                (unsigned long) (i / sizeof(token_t)));
+        print_expected(t, &l->ex[i / sizeof(token_t)]);
+    }
+    return 1;
+}
+
+double now(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+/* Best throughput in MB/s of engine over BENCH_RUNS runs on in */
+double bench(const char* engine, const char* in, size_t bytes,
+        const char* out) {
+    double best = 0;
+    for (int i = 0; i < BENCH_RUNS; i++) {
+        double start = now();
+        if (run_engine(engine, in, out)) return -1;
+        double mbps = bytes / 1e6 / (now() - start);
+        if (mbps > best) best = mbps;
+    }
+    return best;
+}
+
+/* Record the throughput of every engine in path */
+int write_baselines(const char* path, const char** engines, double* mbps,
+        int n) {
+    FILE* f = fopen(path, "w");
+    if (!f) {
+        fprintf(stderr, "Cannot write %s\n", path);
+        return 1;
+    }
+    fprintf(f, "# MB/s engine -- written by make verify-baseline\n");
+    for (int i = 0; i < n; i++) {
+        fprintf(f, "%.2f %s\n", mbps[i], engines[i]);
+    }
+    fclose(f);
+    printf("Baseline of %d engine(s) written to %s\n", n, path);
+    return 0;
+}
+
+/*
+ * Compare engine's throughput mbps on in with its baseline line, timing it
+ * once more before calling it a regression; 0 if not slower
+ */
+int check_baseline(const char* path, const char* engine, double mbps,
+        double tolerance, const char* in, size_t bytes, const char* out) {
+    char line[CMD_BUFSIZ];
+    double base = -1;
+    FILE* f = fopen(path, "r");
+    while (f && fgets(line, CMD_BUFSIZ, f)) {
+        char* name;
+        double v = strtod(line, &name);
+        if ((*line == '#') || (name == line)) continue;
+        while (*name == ' ') {
+            name++;
+        }
+        name[strcspn(name, "\n")] = '\0';
+        if (!strcmp(name, engine)) base = v;
+    }
+    if (f) fclose(f);
+    if (base < 0) {
+        fprintf(stderr, "No baseline for '%s' in %s; run make"
+                " verify-baseline\n", engine, path);
+        return 1;
+    }
+    if (mbps < base * (1 - tolerance)) {
+        /* A burst of load on the machine alone should not fail the gate */
+        double again = bench(engine, in, bytes, out);
+        if (again > mbps) mbps = again;
+    }
+    if (mbps < base * (1 - tolerance)) {
+        fprintf(stderr, "Throughput regression of '%s': %.2f MB/s is below"
+                " the %.2f MB/s baseline (tolerance %.0f%%)\n", engine, mbps,
+                base, tolerance * 100);
+        return 1;
+    }
+    printf("Baseline of '%s' %.2f MB/s: ok\n", engine, base);
+    return 0;
+}
+
+int make_temp(char* path) {
+    strcpy(path, "/tmp/dcc-verify-XXXXXX");
+    int fd = mkstemp(path);
+    if (fd == -1) return 1;
+    close(fd);
+    return 0;
+}
+
+void printhlp(void) {
+    printf("Usage: dcc-verify [-r rounds] [-s seed] [-b baseline]"
+            " [-t tolerance] [-w] [engine command ...]\n");
+}
+
+int main(int argc, char** argv) {
+    uint rounds = VERIFY_ROUNDS;
+    uint64_t seed = 1;
+    const char* baseline = NULL;
+    double tolerance = TOLERANCE_DEF;
+    int write_baseline = 0;
+    int opt;
+    while ((opt = getopt(argc, argv, "r:s:b:t:wh")) != -1) {
+        switch (opt) {
+            case 'r':
+                rounds = (uint) strtoul(optarg, NULL, 10);
+                break;
+            case 's':
+                seed = strtoull(optarg, NULL, 10);
+                break;
+            case 'b':
+                baseline = optarg;
+                break;
+            case 't':
+                tolerance = strtod(optarg, NULL);
+                break;
+            case 'w':
+                write_baseline = 1;
+                break;
+            default:
+                printhlp();
+                return 1;
+        }
+    }
+    rng_state = seed ? seed : 1;
+
+    char in[32], ref[32], out[32];
+    if (make_temp(in) || make_temp(ref) || make_temp(out)) {
+        fprintf(stderr, "Cannot create temporary files\n");
+        return 1;
+    }
+    text_buf t = { NULL, 0, 0 };
+    expected_list l = { NULL, 0, 0 };
+    int failed = 0;
+    char recover_engine[CMD_BUFSIZ];
+    snprintf(recover_engine, CMD_BUFSIZ, "%s %s", REF_ENGINE, RECOVER_OPT);
+
+    for (uint r = 0; (r < rounds) && !failed; r++) {
+        int errors = !((r + 1) % ERR_ROUND_EVERY);
+        t.len = 0;
+        free_expected(&l);
+        uint nerr = gen_input(&t, &l, 1 + rnd_below(VERIFY_TOKENS), errors);
+        char *refdata = NULL, *data = NULL;
+        decoded_stream aos = { NULL, NULL, 0, 0 };
+        size_t reflen, len;
+        if (write_file(in, &t)) {
+            fprintf(stderr, "Cannot write %s\n", in);
+            failed = 1;
+            break;
+        }
+        /* Reference against the generator's expectations */
+        const char* engine = errors ? recover_engine : REF_ENGINE;
+        int status = run_engine(engine, in, ref);
+        if (status != (nerr ? 4 : 0)) {
+            fprintf(stderr, "Round %u: '%s' exited with %d\n", r, engine,
+                    status);
+            failed = 1;
+        } else if (read_file(ref, &refdata, &reflen)) {
+            fprintf(stderr, "Cannot read %s\n", ref);
+            failed = 1;
+        } else if (decode_aos(refdata, reflen, &aos)
+                || check_decoded(&aos, &l, &t)) {
+            fprintf(stderr, "Round %u: reference output is wrong\n", r);
+            failed = 1;
+        } else if (check_soa(in, out, errors ? " " RECOVER_OPT : "", status,
+                &aos)) {
+            fprintf(stderr, "Round %u: reference SoA output is wrong\n", r);
+            failed = 1;
+        } else if (check_index(in, out, errors ? " " RECOVER_OPT : "", status,
+                &aos, refdata, reflen)) {
+            fprintf(stderr, "Round %u: reference index is wrong\n", r);
+            failed = 1;
+        }
+        /* Every engine against the reference */
+        for (int i = optind; (i < argc) && !failed; i++) {
+            char cmd[CMD_BUFSIZ];
+            snprintf(cmd, CMD_BUFSIZ, errors ? "%s " RECOVER_OPT : "%s",
+                    argv[i]);
+            if (run_engine(cmd, in, out) != (nerr ? 4 : 0)) {
+                fprintf(stderr, "Round %u: '%s' failed\n", r, cmd);
+                failed = 1;
+            } else if (read_file(out, &data, &len)) {
+                fprintf(stderr, "Cannot read %s\n", out);
+                failed = 1;
+            } else {
+                failed = diff_streams(cmd, refdata, reflen, data, len, &l,
+                        &t);
+                if (failed) fprintf(stderr, "Round %u\n", r);
+            }
+            free(data);
+            data = NULL;
+        }
+        free_decoded(&aos);
+        free(refdata);
+    }
+    if (failed) {
+        fprintf(stderr, "Input kept in %s (seed %llu)\n", in,
+                (unsigned long long) seed);
+        unlink(ref);
+        unlink(out);
+        return 1;
+    }
+    if (optind < argc) {
+        printf("%u rounds: %d engine(s) match the reference\n", rounds,
+                argc - optind);
+    } else {
+        printf("%u rounds: reference checked; no engine given to compare\n",
+                rounds);
+    }
+
+    /* Throughput gate */
+    t.len = 0;
+    while (t.len < BENCH_BYTES) {
+        free_expected(&l);
+        gen_input(&t, &l, VERIFY_TOKENS, 0);
+    }
+    free_expected(&l);
+    /* The reference is gated like any engine, and comes first */
+    int nengines = argc - optind + 1;
+    const char** engines = (const char**) malloc(nengines * sizeof(char*));
+    double* mbps = (double*) malloc(nengines * sizeof(double));
+    if (!engines || !mbps || write_file(in, &t)) {
+        fprintf(stderr, "Cannot write %s\n", in);
+        failed = 1;
+    }
+    for (int i = 0; (i < nengines) && !failed; i++) {
+        engines[i] = i ? argv[optind + i - 1] : REF_ENGINE;
+        mbps[i] = bench(engines[i], in, t.len, out);
+        if (mbps[i] < 0) {
+            fprintf(stderr, "Benchmark run of '%s' failed\n", engines[i]);
+            failed = 1;
+        } else {
+            printf("Throughput of '%s': %.2f MB/s\n", engines[i], mbps[i]);
+        }
+    }
+    if (!failed && baseline && write_baseline) {
+        failed = write_baselines(baseline, engines, mbps, nengines);
+    } else if (!failed && baseline) {
+        for (int i = 0; i < nengines; i++) {
+            failed |= check_baseline(baseline, engines[i], mbps[i],
+                    tolerance, in, t.len, out);
+        }
+    }
+    unlink(in);
+    unlink(ref);
+    unlink(out);
+    free(engines);
+    free(mbps);
+    return failed;
+}